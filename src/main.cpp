@@ -20,22 +20,33 @@ int freeRam ()
 #define TEST_ITERATIONS 100
 
 #if TEST_CASE==TEST_NEW
-#include "new\table3d.h"
+#define TABLE_SRAM_BUDGET 4096
+#include "new\table_registry.h"
+#include "new\table2d.hpp"
 #include "new\table3d.hpp"
+#include "new\table4d.hpp"
+#include "new\table_scheduler.h"
+#include "new\table_scheduler.hpp"
 
-table3D_impl<16> fuelTable;
-table3D_impl<16> fuelTable2;
-table3D_impl<16> ignitionTable;
-table3D_impl<16> ignitionTable2;
-table3D_impl<16> afrTable;
-table3D_impl<8> stagingTable;
-table3D_impl<8> boostTable;
-table3D_impl<8> vvtTable;
-table3D_impl<8> wmiTable;
-table3D_impl<6> trim1Table;
-table3D_impl<6> trim2Table;
-table3D_impl<6> trim3Table;
-table3D_impl<6> trim4Table;
+#define TABLE_REGISTRY(ENTRY) \
+  ENTRY(fuelTable, 0, table3D_impl<16>) \
+  ENTRY(fuelTable2, 320, table3D_impl<16>) \
+  ENTRY(ignitionTable, 640, table3D_impl<16>) \
+  ENTRY(ignitionTable2, 960, table3D_impl<16>) \
+  ENTRY(afrTable, 1280, table3D_impl<16>) \
+  ENTRY(stagingTable, 1600, table3D_impl<8>) \
+  ENTRY(boostTable, 1696, table3D_impl<8>) \
+  ENTRY(vvtTable, 1792, table3D_impl<8>) \
+  ENTRY(wmiTable, 1888, table3D_impl<8>) \
+  ENTRY(trim1Table, 1984, table3D_impl<6>) \
+  ENTRY(trim2Table, 2044, table3D_impl<6>) \
+  ENTRY(trim3Table, 2104, table3D_impl<6>) \
+  ENTRY(trim4Table, 2164, table3D_impl<6>) \
+  ENTRY(bankTrimTable, 2224, table3D_impl<6, 2>) /* Per bank trim, looked up once for each bank */ \
+  ENTRY(flexFuelTable, 2284, table4D_impl<16, 2>) /* E0 & E85 fuel maps */ \
+  ENTRY(warmupCurve, 2864, table2D_impl<10>)
+
+DEFINE_TABLE_REGISTRY(TABLE_REGISTRY)
 
 typedef table3D ITable3D;
 
@@ -51,6 +62,420 @@ long testHarnessGet3dTableValue(table3D *pTable, int16_t xValue, int16_t yValue)
   return get3DTableValue(pTable, yValue, xValue);
 }
 
+int16_t warmupAxis[10] = { -40, -26, 10, 19, 28, 37, 50, 65, 80, 102 };
+int8_t warmupValues[10] = { 98, 85, 58, 48, 40, 34, 28, 20, 12, 0 };
+
+void setup2DTable(table2D *pTable, const int8_t *pValues, const int16_t *pXAxis)
+{
+  memcpy(pTable->getXAxis(), pXAxis, pTable->axisSize * sizeof(int16_t));
+  memcpy(pTable->getValues(), pValues, pTable->valuesSizeInBytes());
+}
+
+long test2DTable(table2D *pTable)
+{
+  long sum = 0;
+  for (int16_t loop = 0; loop<TEST_ITERATIONS; loop++)
+  {
+    // Sweep the whole axis (plus a little either side) in uneven steps, so there is a mix of on & between bin values
+    for (int16_t temperature = -45; temperature<110; temperature += 3)
+    {
+      sum = sum + get2DTableValue(pTable, temperature);
+    }
+  }
+  return sum;
+}
+
+int16_t zAxis[2] = { 0, 85 };
+// Ethanol content values for the 4D tests. A mix of on & between the Z axis bins
+int16_t zValues[4] = { 0, 30, 85, 60 };
+
+void setup4DTable(table4D *pTable, const int8_t *pValues, const int16_t *pXAxis, const int16_t *pYAxis)
+{
+  memcpy(pTable->getXAxis(), pXAxis, pTable->axisSizeInBytes());
+  memcpy(pTable->getYAxis(), pYAxis, pTable->axisSizeInBytes());
+  memcpy(pTable->getZAxis(), zAxis, sizeof(zAxis));
+  for (uint8_t z=0; z<pTable->zAxisSize; z++)
+  {
+    memcpy(pTable->getLayer(z), pValues, pTable->layerSizeInBytes());
+  }
+}
+
+long test4DTable(table4D *pTable, const int16_t *pXAxis, const int16_t *pYAxis)
+{
+  long sum = 0;
+  for (int16_t loop = 0; loop<TEST_ITERATIONS; loop++)
+  {
+    for (int8_t loopX = 0; loopX<16; loopX++)
+    {
+      for (int8_t loopY = 0; loopY<16; loopY++)
+      {
+        sum = sum + get4DTableValue(pTable, zValues[loopY % _countof(zValues)], pYAxis[LOOP_INDEXER(loopY, 16)], pXAxis[LOOP_INDEXER(loopX, 16)]);
+      }
+    }
+  }
+  return sum;
+}
+
+// The alternative to a 4D table: look up 2 3D tables & blend by hand
+long testBlended3DTables(table3D *pLow, table3D *pHigh, const int16_t *pXAxis, const int16_t *pYAxis)
+{
+  long sum = 0;
+  for (int16_t loop = 0; loop<TEST_ITERATIONS; loop++)
+  {
+    for (int8_t loopX = 0; loopX<16; loopX++)
+    {
+      for (int8_t loopY = 0; loopY<16; loopY++)
+      {
+        int16_t Z = zValues[loopY % _countof(zValues)];
+        int low = get3DTableValue(pLow, pYAxis[LOOP_INDEXER(loopY, 16)], pXAxis[LOOP_INDEXER(loopX, 16)]);
+        int high = get3DTableValue(pHigh, pYAxis[LOOP_INDEXER(loopY, 16)], pXAxis[LOOP_INDEXER(loopX, 16)]);
+        unsigned long s = ((unsigned long)(Z - zAxis[0]) << TABLE_SHIFT_FACTOR) / (zAxis[1] - zAxis[0]);
+        sum = sum + (((low * (TABLE_SHIFT_POWER - s)) + (high * s)) >> TABLE_SHIFT_FACTOR);
+      }
+    }
+  }
+  return sum;
+}
+
+// Two callers (E.g. one per bank) look up the same table at different operating points, a few
+// times at each. With a single cache entry they evict each other & every lookup misses
+template <class _Table>
+long testAlternatingLookups(_Table *pTable, const int16_t *pXAxis, const int16_t *pYAxis)
+{
+  long sum = 0;
+  for (int16_t loop = 0; loop<TEST_ITERATIONS; loop++)
+  {
+    for (int8_t loopX = 0; loopX<6; loopX++)
+    {
+      for (int8_t loopY = 0; loopY<6; loopY++)
+      {
+        int16_t X = pXAxis[LOOP_INDEXER(loopX, 6)] + 25;
+        int16_t Y = pYAxis[LOOP_INDEXER(loopY, 6)] - 1;
+        for (int8_t cycle = 0; cycle<4; cycle++)
+        {
+          sum = sum + get3DTableValue(pTable, Y, X);
+          sum = sum + get3DTableValue(pTable, Y - 3, X + 150);
+        }
+      }
+    }
+  }
+  return sum;
+}
+
+// The step used to estimate the slope with offset lookups
+#define GRADIENT_X_STEP 50
+#define GRADIENT_Y_STEP 2
+
+// The value & slope (in Q8) from a single lookup
+long testGradientLookup(table3D *pTable, const int16_t *pXAxis, const int16_t *pYAxis)
+{
+  long sum = 0;
+  long xGradient, yGradient;
+  for (int16_t loop = 0; loop<TEST_ITERATIONS; loop++)
+  {
+    for (int8_t loopX = 0; loopX<16; loopX++)
+    {
+      for (int8_t loopY = 0; loopY<16; loopY++)
+      {
+        sum = sum + get3DTableValueAndGradient(pTable, pYAxis[LOOP_INDEXER(loopY, 16)] - 1, pXAxis[LOOP_INDEXER(loopX, 16)] + 25, &xGradient, &yGradient);
+        sum = sum + (xGradient >> (TABLE_GRADIENT_SHIFT_FACTOR - TABLE_SHIFT_FACTOR)) + (yGradient >> (TABLE_GRADIENT_SHIFT_FACTOR - TABLE_SHIFT_FACTOR));
+      }
+    }
+  }
+  return sum;
+}
+
+// The alternative: the value plus 2 more lookups at offset inputs
+long testOffsetGradientLookups(table3D *pTable, const int16_t *pXAxis, const int16_t *pYAxis)
+{
+  long sum = 0;
+  for (int16_t loop = 0; loop<TEST_ITERATIONS; loop++)
+  {
+    for (int8_t loopX = 0; loopX<16; loopX++)
+    {
+      for (int8_t loopY = 0; loopY<16; loopY++)
+      {
+        int16_t X = pXAxis[LOOP_INDEXER(loopX, 16)] + 25;
+        int16_t Y = pYAxis[LOOP_INDEXER(loopY, 16)] - 1;
+        int value = get3DTableValue(pTable, Y, X);
+        int xValue = get3DTableValue(pTable, Y, X + GRADIENT_X_STEP);
+        int yValue = get3DTableValue(pTable, Y + GRADIENT_Y_STEP, X);
+        sum = sum + value;
+        sum = sum + (((long)(xValue - value) << TABLE_SHIFT_FACTOR) / GRADIENT_X_STEP) + (((long)(yValue - value) << TABLE_SHIFT_FACTOR) / GRADIENT_Y_STEP);
+      }
+    }
+  }
+  return sum;
+}
+
+#if defined(__AVR__)
+// Cycle counts for the cache miss path, which sets the worst case tooth latency. Any hand optimised
+// kernel must beat these.
+// Timer1 is run at the CPU clock with interrupts off, so the counts are exact (on hardware or simavr).
+
+#define CYCLE_BARRIER() asm volatile("" ::: "memory")
+
+struct cycleStats {
+  uint32_t total;
+  uint16_t max;
+  uint16_t count;
+};
+
+static inline void addCycles(cycleStats &stats, uint16_t cycles)
+{
+  stats.total += cycles;
+  if (cycles > stats.max) { stats.max = cycles; }
+  stats.count++;
+}
+
+void printCycleStats(const char *pName, const cycleStats &stats)
+{
+  Serial.print(pName);
+  Serial.print(" cycles avg: ");
+  Serial.print(stats.total / stats.count);
+  Serial.print(" max: ");
+  Serial.println(stats.max);
+}
+
+void measureMissCycles(table3D *pTable, const int16_t *pXAxis, const int16_t *pYAxis)
+{
+  cycleStats lookupStats = { 0, 0, 0 };
+  cycleStats binStats = { 0, 0, 0 };
+  cycleStats blendStats = { 0, 0, 0 };
+  volatile int sink;
+
+  noInterrupts();
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10); // No prescaler: 1 count per CPU cycle
+  TCNT1 = 0;
+  CYCLE_BARRIER();
+  const uint16_t overhead = TCNT1;
+
+  for (int16_t loop = 0; loop<4; loop++)
+  {
+    for (int8_t loopX = 0; loopX<16; loopX++)
+    {
+      for (int8_t loopY = 0; loopY<16; loopY++)
+      {
+        // Offset from the bins, so the interpolation is always needed. Moving around the table
+        // (LOOP_INDEXER) exercises both the cached bin checks & the full search
+        volatile int16_t X = pXAxis[LOOP_INDEXER(loopX, 16)] + (loop * 37) - 50;
+        volatile int16_t Y = pYAxis[LOOP_INDEXER(loopY, 16)] + loop - 2;
+
+        // 1. The bin search alone, from the same cached bins the lookup will start from
+        byte xMin = pTable->lastXMin, xMax = pTable->lastXMax;
+        byte yMin = pTable->lastYMin, yMax = pTable->lastYMax;
+        int16_t x = X, y = Y;
+        if (x > pXAxis[pTable->axisSize-1]) { x = pXAxis[pTable->axisSize-1]; }
+        if (x < pXAxis[0]) { x = pXAxis[0]; }
+        if (y > pYAxis[0]) { y = pYAxis[0]; }
+        if (y < pYAxis[pTable->axisSize-1]) { y = pYAxis[pTable->axisSize-1]; }
+        TCNT1 = 0;
+        CYCLE_BARRIER();
+        findAscendingAxisBin(pTable->getXAxis(), pTable->axisSize, x, xMin, xMax);
+        findDescendingAxisBin(pTable->getYAxis(), pTable->axisSize, y, yMin, yMax);
+        CYCLE_BARRIER();
+        addCycles(binStats, TCNT1 - overhead);
+
+        // 2. The weights & blend alone, for the bin found above
+        const int8_t *pValues = pTable->getValues();
+        TCNT1 = 0;
+        CYCLE_BARRIER();
+        unsigned long p = ascendingAxisWeight(x, pXAxis[xMin], pXAxis[xMax]);
+        unsigned long q = descendingAxisWeight(y, pYAxis[yMin], pYAxis[yMax]);
+        sink = interpolateCorners(pValues[yMin * pTable->axisSize + xMin], pValues[yMin * pTable->axisSize + xMax],
+                                  pValues[yMax * pTable->axisSize + xMin], pValues[yMax * pTable->axisSize + xMax], p, q);
+        CYCLE_BARRIER();
+        addCycles(blendStats, TCNT1 - overhead);
+
+        // 3. The complete lookup, with the input cache invalidated so it always misses
+        pTable->cacheIsValid = false;
+        TCNT1 = 0;
+        CYCLE_BARRIER();
+        sink = get3DTableValue(pTable, Y, X);
+        CYCLE_BARRIER();
+        addCycles(lookupStats, TCNT1 - overhead);
+      }
+    }
+  }
+  interrupts();
+  (void)sink;
+
+  printCycleStats("Miss lookup", lookupStats);
+  printCycleStats("Bin search", binStats);
+  printCycleStats("Weights+blend", blendStats);
+}
+#endif
+
+// A tuner edits a few cells & an axis entry, then burns. Only the changed bytes are written
+void testBurn(table3D *pTable, uint16_t eepromAddress)
+{
+  table3D_setValue(pTable, 2, 3, 35);
+  table3D_setValue(pTable, 2, 4, 37);
+  table3D_setValue(pTable, 9, 12, 60);
+  table3D_setXAxisValue(pTable, 5, 2700);
+
+  unsigned long StartTime = micros();
+  uint16_t bytesWritten = table3D_burn(pTable, eepromAddress);
+  Serial.print("Burn: ");
+  Serial.print(bytesWritten);
+  Serial.print("/");
+  Serial.print(pTable->dataSizeInBytes());
+  Serial.print(" bytes ");
+  Serial.println(micros() - StartTime);
+}
+
+// Batch initialisation of every registered table. Each table is sized from its own header,
+// so adding a table to TABLE_REGISTRY needs no change here
+struct setupTableVisitor {
+  const int8_t *pValues;
+  const int16_t *pXAxis;
+  const int16_t *pYAxis;
+
+  setupTableVisitor(const int8_t *pInitValues, const int16_t *pInitXAxis, const int16_t *pInitYAxis)
+    : pValues(pInitValues), pXAxis(pInitXAxis), pYAxis(pInitYAxis) {}
+
+  inline void operator()(table2D &table) { setup2DTable(&table, warmupValues, warmupAxis); }
+  inline void operator()(table3D &table) { setupTable(&table, table.axisSize, pValues, pXAxis, pYAxis); }
+  inline void operator()(table4D &table) { setup4DTable(&table, pValues, pXAxis, pYAxis); }
+};
+
+// Simulated engine state for the scheduler tests
+int16_t currentRPM;
+int16_t currentLoad;
+
+table3DSchedule schedules[4];
+table3DScheduleGroup scheduleGroup;
+
+// Simulate the main loop with the engine slowly accelerating: RPM rises by 5 & load
+// by 1 every 4 loops, with one engine cycle every 8 loops
+#define SIMULATED_LOOPS 2000
+static inline void simulateEngine(int16_t loop, const int16_t *pXAxis, const int16_t *pYAxis)
+{
+  currentRPM = pXAxis[0] + ((loop/4) * 5) % (pXAxis[15] - pXAxis[0]);
+  currentLoad = pYAxis[15] + ((loop/4) % (pYAxis[0] - pYAxis[15]));
+  if ((loop % 8) == 0) { tableSchedule_engineCycle(); }
+}
+
+long testScheduledTables(const int16_t *pXAxis, const int16_t *pYAxis)
+{
+  long sum = 0;
+  for (int16_t loop = 0; loop<SIMULATED_LOOPS; loop++)
+  {
+    simulateEngine(loop, pXAxis, pYAxis);
+    tableScheduleGroup_service(&scheduleGroup);
+    for (uint8_t index = 0; index<_countof(schedules); index++)
+    {
+      sum = sum + tableSchedule_getValue(&schedules[index]);
+    }
+  }
+  return sum;
+}
+
+// The same workload, looking up every table on every loop
+long testUnscheduledTables(const int16_t *pXAxis, const int16_t *pYAxis)
+{
+  long sum = 0;
+  for (int16_t loop = 0; loop<SIMULATED_LOOPS; loop++)
+  {
+    simulateEngine(loop, pXAxis, pYAxis);
+    for (uint8_t index = 0; index<_countof(schedules); index++)
+    {
+      sum = sum + get3DTableValue(schedules[index].pTable, currentLoad, currentRPM);
+    }
+  }
+  return sum;
+}
+
+void runNewTableTests(const int16_t *pXAxis, const int16_t *pYAxis)
+{
+#if defined(__AVR__)
+  measureMissCycles(&fuelTable, pXAxis, pYAxis);
+#endif
+
+  testBurn(&ignitionTable, ignitionTableEepromAddress);
+
+  // Every table, each at its own EEPROM address. The 2D & 4D tables don't track changes, so are written in full
+  unsigned long StartTime = micros();
+  uint16_t bytesWritten = tableRegistry_burn();
+  Serial.print("Burn all: ");
+  Serial.print(bytesWritten);
+  Serial.print(" bytes ");
+  Serial.println(micros() - StartTime);
+
+  StartTime = millis();
+  long sum = test2DTable(&warmupCurve);
+  Serial.print("2D: ");
+  Serial.print(sum);
+  Serial.print(" ");
+  Serial.println(millis() - StartTime);
+
+  StartTime = millis();
+  sum = test4DTable(&flexFuelTable, pXAxis, pYAxis);
+  Serial.print("4D: ");
+  Serial.print(sum);
+  Serial.print(" ");
+  Serial.println(millis() - StartTime);
+
+  StartTime = millis();
+  sum = testBlended3DTables(&fuelTable, &fuelTable2, pXAxis, pYAxis);
+  Serial.print("2x3D+blend: ");
+  Serial.print(sum);
+  Serial.print(" ");
+  Serial.println(millis() - StartTime);
+
+  // The sums differ slightly: the offset lookups estimate the slope from a step, which is quantised
+  // to whole table values & crosses into the next bin near the bin edges
+  StartTime = millis();
+  sum = testAlternatingLookups(&bankTrimTable, pXAxis, pYAxis);
+  Serial.print("Memo x2: ");
+  Serial.print(sum);
+  Serial.print(" ");
+  Serial.println(millis() - StartTime);
+
+  StartTime = millis();
+  sum = testAlternatingLookups(&trim2Table, pXAxis, pYAxis);
+  Serial.print("Memo x1: ");
+  Serial.print(sum);
+  Serial.print(" ");
+  Serial.println(millis() - StartTime);
+
+  StartTime = millis();
+  sum = testGradientLookup(&afrTable, pXAxis, pYAxis);
+  Serial.print("Value+gradient: ");
+  Serial.print(sum);
+  Serial.print(" ");
+  Serial.println(millis() - StartTime);
+
+  StartTime = millis();
+  sum = testOffsetGradientLookups(&afrTable, pXAxis, pYAxis);
+  Serial.print("3x3D: ");
+  Serial.print(sum);
+  Serial.print(" ");
+  Serial.println(millis() - StartTime);
+
+  tableSchedule_init(&schedules[0], &trim1Table, &currentLoad, &currentRPM, 2, 100, 50, TABLE_BUDGET_MS);
+  tableSchedule_init(&schedules[1], &wmiTable, &currentLoad, &currentRPM, 2, 100, 50, TABLE_BUDGET_MS);
+  tableSchedule_init(&schedules[2], &vvtTable, &currentLoad, &currentRPM, 1, 50, 4, TABLE_BUDGET_CYCLES);
+  tableSchedule_init(&schedules[3], &boostTable, &currentLoad, &currentRPM, 1, 50, 4, TABLE_BUDGET_CYCLES);
+  tableScheduleGroup_init(&scheduleGroup, schedules, _countof(schedules));
+
+  // The sums differ slightly: the scheduled values lag the inputs by up to the thresholds
+  StartTime = millis();
+  sum = testScheduledTables(pXAxis, pYAxis);
+  Serial.print("Scheduled: ");
+  Serial.print(sum);
+  Serial.print(" ");
+  Serial.println(millis() - StartTime);
+
+  StartTime = millis();
+  sum = testUnscheduledTables(pXAxis, pYAxis);
+  Serial.print("Unscheduled: ");
+  Serial.print(sum);
+  Serial.print(" ");
+  Serial.println(millis() - StartTime);
+}
+
 #elif TEST_CASE==TEST_ORIGINAL
 #include "src\table.h"
 #include "src\table.hpp"
@@ -160,6 +585,9 @@ void setup() {
     { 66, 69, 70, 70, 72, 73, 74, 74, 74, 74, 74, 74, 73, 72, 71, 71 },  
   };
 
+#if TEST_CASE==TEST_NEW
+  tableRegistry_forEach(setupTableVisitor(&values[0][0], xAxis, yAxis));
+#else
   setupTable(&fuelTable, 16, &values[0][0], xAxis, yAxis);
   setupTable(&fuelTable2, 16, &values[0][0], xAxis, yAxis);
   setupTable(&ignitionTable, 16, &values[0][0], xAxis, yAxis);
@@ -173,6 +601,7 @@ void setup() {
   setupTable(&trim2Table, 6, &values[0][0], xAxis, yAxis);
   setupTable(&trim3Table, 6, &values[0][0], xAxis, yAxis);
   setupTable(&trim4Table, 6, &values[0][0], xAxis, yAxis);
+#endif
 
   Serial.println(freeRam()); 
   unsigned long StartTime = millis();
@@ -188,6 +617,10 @@ void setup() {
   Serial.println(ElapsedTime);
   Serial.println(freeRam()); 
   Serial.println(sizeof(table3D));
+
+#if TEST_CASE==TEST_NEW
+  runNewTableTests(xAxis, yAxis);
+#endif
 }
 
 void loop() {
@@ -0,0 +1,67 @@
+/*
+Compact 2D tables (curves). These share the axis search, caching & interpolation code with the 3D tables
+*/
+#ifndef TABLE2D_H
+#define TABLE2D_H
+#include <Arduino.h>
+#include "table_common.h"
+
+struct table2D {
+protected:
+  // Prevent direct creation - must use derived class
+  table2D(int8_t size) : axisSize(size), cacheIsValid(false) {}
+
+public:
+  int8_t axisSize;
+
+  //Store the last X bin in the table. This is used to make the next check faster
+  byte lastXMax, lastXMin;
+
+  //Store the last input and output values, again for caching purposes
+  int16_t lastXInput;
+  byte lastOutput; //This will need changing if we ever have 16-bit table values
+  bool cacheIsValid; ///< This tracks whether the tables cache should be used. Ordinarily this is true, but is set to false whenever TunerStudio sends a new value for the table
+
+  // These will be completely inlined.
+  inline int16_t valuesSizeInBytes() const { return axisSize*sizeof(int8_t); }
+  // Size of the values + axis. This is also the table footprint in EEPROM
+  inline int16_t dataSizeInBytes() const { return valuesSizeInBytes()+(axisSize*sizeof(int16_t)); }
+
+  // These rely on the derived class memory layout - see table3D
+  inline int16_t* getXAxis() const { return (int16_t*)((int8_t*)this+sizeof(table2D)+valuesSizeInBytes()); }
+  inline int8_t* getValues() const { return (int8_t*)this+sizeof(table2D); }
+
+  // Derived table2D_impl will place data here
+  // int8_t values[size]
+  // int16_t _axisX[size];
+};
+
+template <int8_t _Size>
+struct table2D_impl: public table2D
+{
+public:
+  table2D_impl() : table2D(_Size)
+  {
+  }
+
+  // The EEPROM footprint (dataSizeInBytes()) at compile time
+  static constexpr uint16_t eepromSize = (_Size*sizeof(int8_t)) + (_Size*sizeof(int16_t));
+
+private:
+  int8_t _values[_Size];
+  int16_t _axisX[_Size];
+};
+
+/*
+The X axis is ascending. Values are linearly interpolated between the bins
+either side of the requested X value & clamped to the first/last value
+outside the axis range.
+*/
+int get2DTableValue(struct table2D *fromTable, int);
+
+// Write the table to EEPROM, starting at eepromAddress. The EEPROM layout mirrors
+// the in-memory data (values, X axis). Curves don't track changes, so this updates
+// every byte (EEPROM.update() skips the unchanged ones). Returns the number of bytes written
+uint16_t table2D_burn(const struct table2D *pTable, uint16_t eepromAddress);
+
+#endif // TABLE2D_H
@@ -0,0 +1,59 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "table2d.h"
+#include "table_common.hpp"
+
+//This function pulls a value from a 2D table given a target for the X coordinate.
+//It uses the same bin search & fixed point interpolation as get3DTableValue
+int get2DTableValue(table2D *fromTable, int X_in)
+{
+  int X = X_in;
+
+  int tableResult = 0;
+  const int16_t *pXAxis = fromTable->getXAxis();
+  int xMinValue = pXAxis[0];
+  int xMaxValue = pXAxis[fromTable->axisSize-1];
+
+  //If the requested X value is greater/small than the maximum/minimum bin, reset X to be that value
+  if(X > xMaxValue) { X = xMaxValue; }
+  if(X < xMinValue) { X = xMinValue; }
+
+  //0th check is whether the same X value is being sent as last time. If it is, this not only prevents a lookup of the axis, but prevents the interpolation calcs being performed
+  if( (X_in == fromTable->lastXInput) && (fromTable->cacheIsValid == true))
+  {
+    return fromTable->lastOutput;
+  }
+
+  findAscendingAxisBin(pXAxis, fromTable->axisSize, X, fromTable->lastXMin, fromTable->lastXMax);
+  byte xMin = fromTable->lastXMin;
+  byte xMax = fromTable->lastXMax;
+
+  const int8_t *pValues = fromTable->getValues();
+  int A = pValues[xMin];
+  int B = pValues[xMax];
+
+  //Check that the values aren't just the same (Flat curve, or the value was hit straight on)
+  if (A == B) { tableResult = A; }
+  else
+  {
+    unsigned long p = ascendingAxisWeight(X, pXAxis[xMin], pXAxis[xMax]);
+    tableResult = ( (A * (TABLE_SHIFT_POWER-p)) + (B * p) ) >> TABLE_SHIFT_FACTOR;
+  }
+
+  //Update the tables cache data
+  fromTable->lastXInput = X_in;
+  fromTable->lastOutput = tableResult;
+  fromTable->cacheIsValid = true;
+
+  return tableResult;
+}
+
+uint16_t table2D_burn(const table2D *pTable, uint16_t eepromAddress)
+{
+  const uint8_t *pData = (const uint8_t*)pTable->getValues();
+  for (int16_t loop = 0; loop < pTable->dataSizeInBytes(); loop++)
+  {
+    EEPROM.update(eepromAddress + loop, pData[loop]);
+  }
+  return pTable->dataSizeInBytes();
+}
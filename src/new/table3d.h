@@ -4,18 +4,18 @@ This file is used for everything related to maps/tables including their definiti
 #ifndef TABLE_H
 #define TABLE_H
 #include <Arduino.h>
+#include "table_common.h"
 
-#define TABLE_RPM_MULTIPLIER  100
-#define TABLE_LOAD_MULTIPLIER 2
-
-//The shift amount used for the 3D table calculations
-#define TABLE_SHIFT_FACTOR  8
-#define TABLE_SHIFT_POWER   (1UL<<TABLE_SHIFT_FACTOR)
+// An additional input/output cache entry. See table3D_impl
+struct table3D_memo {
+  int16_t xInput, yInput;
+  byte output;
+};
 
 struct table3D {  
 protected:
   // Prevent direct creation - must use derived class
-  table3D(int8_t size) : axisSize(size) {}
+  table3D(int8_t size) : axisSize(size), cacheIsValid(false), changeCount(0) {}
 
 public:
   int8_t axisSize;
@@ -28,10 +28,17 @@ public:
   int16_t lastXInput, lastYInput;
   byte lastOutput; //This will need changing if we ever have 16-bit table values
   bool cacheIsValid; ///< This tracks whether the tables cache should be used. Ordinarily this is true, but is set to false whenever TunerStudio sends a new value for the table
+  //Incremented whenever the table data changes (see table3D_invalidate). Anything holding on to a lookup result (E.g. a table3DSchedule)
+  //compares this with the count at the time of the lookup. 16 bits, so a burst of edits (E.g. a page write) can't wrap it back round
+  uint16_t changeCount;
 
   // These will be completely inlined.
   inline int16_t valuesSizeInBytes() const { return sq(axisSize)*sizeof(int8_t); }
   inline int16_t axisSizeInBytes() const { return axisSize*sizeof(int16_t); }
+  // Size of the values + both axes. This is also the table footprint in EEPROM
+  inline int16_t dataSizeInBytes() const { return valuesSizeInBytes()+(2*axisSizeInBytes()); }
+  // One bit per value plus one bit per axis entry
+  inline int16_t dirtySizeInBytes() const { return (sq(axisSize)+(2*axisSize)+7)/8; }
 
   // These rely on the derived class memory layout. Alternatives are:
   // 1. Virtual functions (SRAM bloat)
@@ -40,26 +47,64 @@ public:
   inline int16_t* getXAxis() const { return (int16_t*)((int8_t*)this+sizeof(table3D)+valuesSizeInBytes()); }
   inline int16_t* getYAxis() const { return (int16_t*)((int8_t*)this+sizeof(table3D)+valuesSizeInBytes()+axisSizeInBytes()); }
   inline int8_t* getValues() const { return (int8_t*)this+sizeof(table3D); }
+  inline uint8_t* getDirtyBits() const { return (uint8_t*)this+sizeof(table3D)+dataSizeInBytes(); }
 
   // Derived table3D_impl will place data here
   // int8_t values[size][size]
   // int16_t _axisX[size];
   // int16_t _axisY[size];
+  // uint8_t _dirty[(size*size + 2*size + 7)/8];
 };
 
 // PR#520 - modified slightly
+//
+// _MemoSize is the number of (X, Y) -> value lookups cached by the table. The default of 1 is
+// enough for a table with a single caller. Tables consulted at several operating points in the
+// same cycle (E.g. per bank trims) should use one entry per operating point, otherwise the
+// callers evict each other & every lookup misses.
+template <int8_t _Size, uint8_t _MemoSize = 1>
+struct table3D_impl;
+
 template <int8_t _Size>
-struct table3D_impl: public table3D
+struct table3D_impl<_Size, 1>: public table3D
 {
+  static_assert(_Size>0 && _Size<=31, "Table size must be between 1 and 31");
+
 public:
   table3D_impl() : table3D(_Size)
   {
+    // Only static tables are zero initialised - a new table has nothing to burn
+    memset(_dirty, 0, sizeof(_dirty));
   }
 
+  // The EEPROM footprint (dataSizeInBytes()) at compile time
+  static constexpr uint16_t eepromSize = (_Size*_Size*sizeof(int8_t)) + (2*_Size*sizeof(int16_t));
+
 private:
   int8_t _values[_Size*_Size];
   int16_t _axisX[_Size];
   int16_t _axisY[_Size];
+  // Tracks which values & axis entries have changed since the last burn.
+  // Bit order matches the data layout: values, then X axis, then Y axis
+  uint8_t _dirty[(_Size*_Size + 2*_Size + 7)/8];
+};
+
+// The first cache entry lives in table3D, the extra ones are appended to the table data.
+// Only the get3DTableValue() overload for this type knows about them, so the table3D lookup
+// (& every table without them) is unchanged
+template <int8_t _Size, uint8_t _MemoSize>
+struct table3D_impl: public table3D_impl<_Size, 1>
+{
+  static_assert(_MemoSize>1 && _MemoSize<=8, "Memo size must be between 1 and 8");
+
+public:
+  // The entries are stale until the first lookup
+  table3D_impl() : memoChangeCount(this->changeCount-1)
+  {
+  }
+
+  uint16_t memoChangeCount; ///< table3D::changeCount when the entries were filled. They are stale once the table has changed
+  table3D_memo memo[_MemoSize-1]; ///< The lookups before the last one, most recent first
 };
 
 /*
@@ -77,4 +122,78 @@ Eg: 2x2 table
 */
 int get3DTableValue(struct table3D *fromTable, int, int);
 
+// Tables with extra cache entries: check those before the lookup & keep the previous lookup on a miss.
+// Calls through a table3D* (E.g. from a table3DSchedule) bypass the extra entries, but are still correct
+template <int8_t _Size, uint8_t _MemoSize>
+int get3DTableValue(table3D_impl<_Size, _MemoSize> *fromTable, int Y, int X)
+{
+  if ( (fromTable->cacheIsValid == true) && (X == fromTable->lastXInput) && (Y == fromTable->lastYInput) )
+  {
+    return fromTable->lastOutput;
+  }
+
+  table3D_memo *pMemo = fromTable->memo;
+  if (fromTable->memoChangeCount == fromTable->changeCount)
+  {
+    for (uint8_t loop = 0; loop < (_MemoSize-1); loop++)
+    {
+      if ( (X == pMemo[loop].xInput) && (Y == pMemo[loop].yInput) ) { return pMemo[loop].output; }
+    }
+
+    //The previous lookup is about to be replaced, so move it into the extra entries. The oldest entry drops off the end
+    if (fromTable->cacheIsValid == true)
+    {
+      memmove(pMemo+1, pMemo, (_MemoSize-2)*sizeof(table3D_memo));
+      pMemo[0].xInput = fromTable->lastXInput;
+      pMemo[0].yInput = fromTable->lastYInput;
+      pMemo[0].output = fromTable->lastOutput;
+    }
+    return get3DTableValue((table3D*)fromTable, Y, X);
+  }
+
+  //All of the entries are stale. Rather than track validity per entry, overwrite them with (harmless) copies of this lookup
+  int tableResult = get3DTableValue((table3D*)fromTable, Y, X);
+  for (uint8_t loop = 0; loop < (_MemoSize-1); loop++)
+  {
+    pMemo[loop].xInput = X;
+    pMemo[loop].yInput = Y;
+    pMemo[loop].output = tableResult;
+  }
+  fromTable->memoChangeCount = fromTable->changeCount;
+  return tableResult;
+}
+
+// Tables without extra cache entries go straight to the table3D lookup
+template <int8_t _Size>
+inline int get3DTableValue(table3D_impl<_Size, 1> *fromTable, int Y, int X)
+{
+  return get3DTableValue((table3D*)fromTable, Y, X);
+}
+
+//The shift amount used for the gradients returned by get3DTableValueAndGradient().
+//This is larger than TABLE_SHIFT_FACTOR since the axis bins are often far apart (E.g. RPM)
+#define TABLE_GRADIENT_SHIFT_FACTOR 16
+
+/*
+Single pass lookup of the value plus the local slope of the table: dValue/dX & dValue/dY,
+in table units per axis unit scaled by (1<<TABLE_GRADIENT_SHIFT_FACTOR).
+The slope is taken across the bin containing (X, Y) & is zero outside the axis range.
+*/
+int get3DTableValueAndGradient(struct table3D *fromTable, int Y, int X, long *pXGradient, long *pYGradient);
+
+// Call after changing the table data directly (E.g. loading a new tune). Clears the lookup cache & increments changeCount
+void table3D_invalidate(struct table3D *pTable);
+
+// Tuner write access. These invalidate the lookup cache and record the change
+// so that table3D_burn() only needs to write what has actually been modified
+void table3D_setValue(struct table3D *pTable, byte row, byte col, int8_t value);
+void table3D_setXAxisValue(struct table3D *pTable, byte index, int16_t value);
+void table3D_setYAxisValue(struct table3D *pTable, byte index, int16_t value);
+bool table3D_isDirty(const struct table3D *pTable);
+
+// Write the changed values & axis entries to EEPROM. The EEPROM layout mirrors
+// the in-memory data (values, X axis, Y axis) starting at eepromAddress.
+// Returns the number of bytes written
+uint16_t table3D_burn(struct table3D *pTable, uint16_t eepromAddress);
+
 #endif // TABLE_H
@@ -1,6 +1,26 @@
 #include <Arduino.h>
+#include <EEPROM.h>
 #include "table3d.h"
+#include "table_common.hpp"
 
+//Bilinear interpolation between the 4 corners (see get3DTableValue) given the normalised X & Y positions
+static inline int interpolateCorners(int A, int B, int C, int D, unsigned long p, unsigned long q)
+{
+  uint32_t m = ((TABLE_SHIFT_POWER-p) * (TABLE_SHIFT_POWER-q)) >> TABLE_SHIFT_FACTOR;
+  uint32_t n = (p * (TABLE_SHIFT_POWER-q)) >> TABLE_SHIFT_FACTOR;
+  uint32_t o = ((TABLE_SHIFT_POWER-p) * q) >> TABLE_SHIFT_FACTOR;
+  uint32_t r = (p * q) >> TABLE_SHIFT_FACTOR;
+  return ( (A * m) + (B * n) + (C * o) + (D * r) ) >> TABLE_SHIFT_FACTOR;
+}
+
+//Update the tables cache data with a new lookup result
+static inline void updateCache(table3D *fromTable, int X_in, int Y_in, int tableResult)
+{
+  fromTable->lastXInput = X_in;
+  fromTable->lastYInput = Y_in;
+  fromTable->lastOutput = tableResult;
+  fromTable->cacheIsValid = true;
+}
 
 //This function pulls a value from a 3D table given a target for X and Y coordinates.
 //It performs a 2D linear interpolation as descibred in: www.megamanual.com/v22manual/ve_tuner.pdf
@@ -10,18 +30,6 @@ int get3DTableValue(table3D *fromTable, int Y_in, int X_in)
     int Y = Y_in;
 
     int tableResult = 0;
-    //Loop through the X axis bins for the min/max pair
-    //Note: For the X axis specifically, rather than looping from tableAxisX[0] up to tableAxisX[max], we start at tableAxisX[Max] and go down.
-    //      This is because the important tables (fuel and injection) will have the highest RPM at the top of the X axis, so starting there will mean the best case occurs when the RPM is highest (And hence the CPU is needed most)
-    const int16_t *pXAxis = fromTable->getXAxis();
-    int xMinValue = pXAxis[0];
-    int xMaxValue = pXAxis[fromTable->axisSize-1];
-    byte xMin = 0;
-    byte xMax = 0;
-
-    //If the requested X value is greater/small than the maximum/minimum bin, reset X to be that value
-    if(X > xMaxValue) { X = xMaxValue; }
-    if(X < xMinValue) { X = xMinValue; }
 
     //0th check is whether the same X and Y values are being sent as last time. If they are, this not only prevents a lookup of the axis, but prevents the interpolation calcs being performed
     if( (X_in == fromTable->lastXInput) && (Y_in == fromTable->lastYInput) && (fromTable->cacheIsValid == true))
@@ -29,136 +37,40 @@ int get3DTableValue(table3D *fromTable, int Y_in, int X_in)
       return fromTable->lastOutput;
     }
 
-    //Commence the lookups on the X and Y axis
+    //The bin searches write to the table through byte references, which could alias axisSize.
+    //So read it (and everything derived from it) once, up front
+    const int8_t axisSize = fromTable->axisSize;
+    const int16_t *pXAxis = fromTable->getXAxis();
+    const int16_t *pYAxis = pXAxis + axisSize;
 
-    //1st check is whether we're still in the same X bin as last time
-    if ( (X <= pXAxis[fromTable->lastXMax]) && (X > pXAxis[fromTable->lastXMin]) )
-    {
-      xMaxValue = pXAxis[fromTable->lastXMax];
-      xMinValue = pXAxis[fromTable->lastXMin];
-      xMax = fromTable->lastXMax;
-      xMin = fromTable->lastXMin;
-    }
-    //2nd check is whether we're in the next RPM bin (To the right)
-    else if ( ((fromTable->lastXMax + 1) < fromTable->axisSize ) && (X <= pXAxis[fromTable->lastXMax +1 ]) && (X > pXAxis[fromTable->lastXMin + 1]) ) //First make sure we're not already at the last X bin
-    {
-      xMax = fromTable->lastXMax + 1;
-      fromTable->lastXMax = xMax;
-      xMin = fromTable->lastXMin + 1;
-      fromTable->lastXMin = xMin;
-      xMaxValue = pXAxis[fromTable->lastXMax];
-      xMinValue = pXAxis[fromTable->lastXMin];
-    }
-    //3rd check is to look at the previous bin (to the left)
-    else if ( (fromTable->lastXMin > 0 ) && (X <= pXAxis[fromTable->lastXMax - 1]) && (X > pXAxis[fromTable->lastXMin - 1]) ) //First make sure we're not already at the first X bin
-    {
-      xMax = fromTable->lastXMax - 1;
-      fromTable->lastXMax = xMax;
-      xMin = fromTable->lastXMin - 1;
-      fromTable->lastXMin = xMin;
-      xMaxValue = pXAxis[fromTable->lastXMax];
-      xMinValue = pXAxis[fromTable->lastXMin];
-    }
-    else
-    //If it's not caught by one of the above scenarios, give up and just run the loop
-    {
-      for (int8_t x = fromTable->axisSize-1; x >= 0; x--)
-      {
-        //Checks the case where the X value is exactly what was requested
-        if ( (X == pXAxis[x]) || (x == 0) )
-        {
-          xMaxValue = pXAxis[x];
-          xMinValue = pXAxis[x];
-          xMax = x;
-          fromTable->lastXMax = xMax;
-          xMin = x;
-          fromTable->lastXMin = xMin;
-          break;
-        }
-        //Normal case
-        if ( (X <= pXAxis[x]) && (X > pXAxis[x-1]) )
-        {
-          xMaxValue = pXAxis[x];
-          xMinValue = pXAxis[x-1];
-          xMax = x;
-          fromTable->lastXMax = xMax;
-          xMin = x-1;
-          fromTable->lastXMin = xMin;
-          break;
-        }
-      }
-    }
+    //Loop through the X axis bins for the min/max pair
+    int xMinValue = pXAxis[0];
+    int xMaxValue = pXAxis[axisSize-1];
+
+    //If the requested X value is greater/small than the maximum/minimum bin, reset X to be that value
+    if(X > xMaxValue) { X = xMaxValue; }
+    if(X < xMinValue) { X = xMinValue; }
+
+    //Commence the lookups on the X and Y axis
+    findAscendingAxisBin(pXAxis, axisSize, X, fromTable->lastXMin, fromTable->lastXMax);
+    byte xMin = fromTable->lastXMin;
+    byte xMax = fromTable->lastXMax;
+    xMinValue = pXAxis[xMin];
+    xMaxValue = pXAxis[xMax];
 
     //Loop through the Y axis bins for the min/max pair
-    const int16_t *pYAxis = fromTable->getYAxis();
     int yMaxValue = pYAxis[0];
-    int yMinValue = pYAxis[fromTable->axisSize-1];
-    byte yMin = 0;
-    byte yMax = 0;
+    int yMinValue = pYAxis[axisSize-1];
 
     //If the requested Y value is greater/small than the maximum/minimum bin, reset Y to be that value
     if(Y > yMaxValue) { Y = yMaxValue; }
     if(Y < yMinValue) { Y = yMinValue; }
 
-    //1st check is whether we're still in the same Y bin as last time
-    if ( (Y >= pYAxis[fromTable->lastYMax]) && (Y < pYAxis[fromTable->lastYMin]) )
-    {
-      yMaxValue = pYAxis[fromTable->lastYMax];
-      yMinValue = pYAxis[fromTable->lastYMin];
-      yMax = fromTable->lastYMax;
-      yMin = fromTable->lastYMin;
-    }
-    //2nd check is whether we're in the next MAP/TPS bin (Next one up)
-    else if ( (fromTable->lastYMin > 0 ) && (Y <= pYAxis[fromTable->lastYMin - 1 ]) && (Y > pYAxis[fromTable->lastYMax - 1]) ) //First make sure we're not already at the top Y bin
-    {
-      yMax = fromTable->lastYMax - 1;
-      fromTable->lastYMax = yMax;
-      yMin = fromTable->lastYMin - 1;
-      fromTable->lastYMin = yMin;
-      yMaxValue = pYAxis[fromTable->lastYMax];
-      yMinValue = pYAxis[fromTable->lastYMin];
-    }
-    //3rd check is to look at the previous bin (Next one down)
-    else if ( ((fromTable->lastYMax + 1) < fromTable->axisSize) && (Y <= pYAxis[fromTable->lastYMin + 1]) && (Y > pYAxis[fromTable->lastYMax + 1]) ) //First make sure we're not already at the bottom Y bin
-    {
-      yMax = fromTable->lastYMax + 1;
-      fromTable->lastYMax = yMax;
-      yMin = fromTable->lastYMin + 1;
-      fromTable->lastYMin = yMin;
-      yMaxValue = pYAxis[fromTable->lastYMax];
-      yMinValue = pYAxis[fromTable->lastYMin];
-    }
-    else
-    //If it's not caught by one of the above scenarios, give up and just run the loop
-    {
-
-      for (int8_t y = fromTable->axisSize-1; y >= 0; y--)
-      {
-        //Checks the case where the Y value is exactly what was requested
-        if ( (Y == pYAxis[y]) || (y==0) )
-        {
-          yMaxValue = pYAxis[y];
-          yMinValue = pYAxis[y];
-          yMax = y;
-          fromTable->lastYMax = yMax;
-          yMin = y;
-          fromTable->lastYMin = yMin;
-          break;
-        }
-        //Normal case
-        if ( (Y >= pYAxis[y]) && (Y < pYAxis[y-1]) )
-        {
-          yMaxValue = pYAxis[y];
-          yMinValue = pYAxis[y-1];
-          yMax = y;
-          fromTable->lastYMax = yMax;
-          yMin = y-1;
-          fromTable->lastYMin = yMin;
-          break;
-        }
-      }
-    }
-
+    findDescendingAxisBin(pYAxis, axisSize, Y, fromTable->lastYMin, fromTable->lastYMax);
+    byte yMin = fromTable->lastYMin;
+    byte yMax = fromTable->lastYMax;
+    yMinValue = pYAxis[yMin];
+    yMaxValue = pYAxis[yMax];
 
     /*
     At this point we have the 4 corners of the map where the interpolated value will fall in
@@ -173,50 +85,194 @@ int get3DTableValue(table3D *fromTable, int Y_in, int X_in)
 
     */
     const int8_t *pValues = fromTable->getValues();
-    int A = pValues[yMin * fromTable->axisSize + xMin];
-    int B = pValues[yMin * fromTable->axisSize + xMax];
-    int C = pValues[yMax * fromTable->axisSize + xMin];
-    int D = pValues[yMax * fromTable->axisSize + xMax];
+    int A = pValues[yMin * axisSize + xMin];
+    int B = pValues[yMin * axisSize + xMax];
+    int C = pValues[yMax * axisSize + xMin];
+    int D = pValues[yMax * axisSize + xMax];
 
     //Check that all values aren't just the same (This regularly happens with things like the fuel trim maps)
     if( (A == B) && (A == C) && (A == D) ) { tableResult = A; }
     else
     {
-      //Create some normalised position values
-      //These are essentially percentages (between 0 and 1) of where the desired value falls between the nearest bins on each axis
+      unsigned long p = ascendingAxisWeight(X, xMinValue, xMaxValue);
+      unsigned long q = descendingAxisWeight(Y, yMinValue, yMaxValue);
+
+      tableResult = interpolateCorners(A, B, C, D, p, q);
+    }
+
+    updateCache(fromTable, X_in, Y_in, tableResult);
+
+    return tableResult;
+}
+
+//As get3DTableValue, but also calculates the slope of the table at (X, Y) from the same 4 corners and weights.
+//Note that this always performs the bin search (using the cached bins) & interpolation, since the gradients are not cached
+int get3DTableValueAndGradient(table3D *fromTable, int Y_in, int X_in, long *pXGradient, long *pYGradient)
+{
+  int X = X_in;
+  int Y = Y_in;
+  const int8_t axisSize = fromTable->axisSize; //See get3DTableValue
+
+  //If the requested X/Y value is greater/small than the maximum/minimum bin, reset it to be that value.
+  //The table is flat outside the axis range, so the gradient along that axis is zero
+  const int16_t *pXAxis = fromTable->getXAxis();
+  bool xClamped = (X > pXAxis[axisSize-1]) || (X < pXAxis[0]);
+  if(X > pXAxis[axisSize-1]) { X = pXAxis[axisSize-1]; }
+  if(X < pXAxis[0]) { X = pXAxis[0]; }
+
+  const int16_t *pYAxis = fromTable->getYAxis();
+  bool yClamped = (Y > pYAxis[0]) || (Y < pYAxis[axisSize-1]);
+  if(Y > pYAxis[0]) { Y = pYAxis[0]; }
+  if(Y < pYAxis[axisSize-1]) { Y = pYAxis[axisSize-1]; }
+
+  findAscendingAxisBin(pXAxis, axisSize, X, fromTable->lastXMin, fromTable->lastXMax);
+  byte xMin = fromTable->lastXMin;
+  byte xMax = fromTable->lastXMax;
+  findDescendingAxisBin(pYAxis, axisSize, Y, fromTable->lastYMin, fromTable->lastYMax);
+  byte yMin = fromTable->lastYMin;
+  byte yMax = fromTable->lastYMax;
+
+  //On a bin boundary the slope is different either side, and if a value was hit straight on the bin has zero width.
+  //So always take the slope across the bin on the higher value side of the boundary (or the lower side at the
+  //end of the axis). The weights for the new corners are then 0 or TABLE_SHIFT_POWER, so the value is unchanged.
+  if ( (X == pXAxis[xMax]) && ((xMax + 1) < axisSize) ) { xMin = xMax; xMax = xMax + 1; }
+  else if ( (xMin == xMax) && (xMin > 0) ) { xMin = xMin - 1; }
+  if ( (Y == pYAxis[yMin]) && (yMin > 0) ) { yMax = yMin; yMin = yMin - 1; }
+  else if ( (yMin == yMax) && ((yMax + 1) < axisSize) ) { yMax = yMax + 1; }
+  int xMinValue = pXAxis[xMin];
+  int xMaxValue = pXAxis[xMax];
+  int yMinValue = pYAxis[yMin];
+  int yMaxValue = pYAxis[yMax];
+
+  //See get3DTableValue for the corner naming
+  const int8_t *pValues = fromTable->getValues();
+  int A = pValues[yMin * axisSize + xMin];
+  int B = pValues[yMin * axisSize + xMax];
+  int C = pValues[yMax * axisSize + xMin];
+  int D = pValues[yMax * axisSize + xMax];
+
+  int tableResult;
+  if( (A == B) && (A == C) && (A == D) )
+  {
+    tableResult = A;
+    *pXGradient = 0;
+    *pYGradient = 0;
+  }
+  else
+  {
+    unsigned long p = ascendingAxisWeight(X, xMinValue, xMaxValue);
+    unsigned long q = descendingAxisWeight(Y, yMinValue, yMaxValue);
+    tableResult = interpolateCorners(A, B, C, D, p, q);
+
+    //d/dX: the change across the bin, weighted by the Y position, over the bin width
+    if (xClamped || (xMaxValue == xMinValue)) { *pXGradient = 0; }
+    else
+    {
+      long deltaX = ((long)(B - A) * (long)(TABLE_SHIFT_POWER-q)) + ((long)(D - C) * (long)q);
+      *pXGradient = (deltaX << (TABLE_GRADIENT_SHIFT_FACTOR - TABLE_SHIFT_FACTOR)) / (xMaxValue - xMinValue);
+    }
+    //d/dY: as above. The Y axis is descending, so the yMin row (A & B) is at the higher Y value
+    if (yClamped || (yMaxValue == yMinValue)) { *pYGradient = 0; }
+    else
+    {
+      long deltaY = ((long)(A - C) * (long)(TABLE_SHIFT_POWER-p)) + ((long)(B - D) * (long)p);
+      *pYGradient = (deltaY << (TABLE_GRADIENT_SHIFT_FACTOR - TABLE_SHIFT_FACTOR)) / (yMinValue - yMaxValue);
+    }
+  }
 
+  //Update the tables cache data, so a following get3DTableValue() call with the same inputs is free
+  updateCache(fromTable, X_in, Y_in, tableResult);
 
-      //Initial check incase the values were hit straight on
+  return tableResult;
+}
 
-      unsigned long p = (long)X - xMinValue;
-      if (xMaxValue == xMinValue) { p = (p << TABLE_SHIFT_FACTOR); }  //This only occurs if the requested X value was equal to one of the X axis bins
-      else { p = ( (p << TABLE_SHIFT_FACTOR) / (xMaxValue - xMinValue) ); } //This is the standard case
+void table3D_invalidate(table3D *pTable)
+{
+  pTable->cacheIsValid = false;
+  pTable->changeCount++;
+}
 
-      unsigned long q;
-      if (yMaxValue == yMinValue)
+static inline void table3D_markDirty(table3D *pTable, uint16_t bit)
+{
+  pTable->getDirtyBits()[bit/8] |= (1U << (bit%8));
+  table3D_invalidate(pTable);
+}
+
+void table3D_setValue(table3D *pTable, byte row, byte col, int8_t value)
+{
+  uint16_t index = (row * pTable->axisSize) + col;
+  int8_t *pValues = pTable->getValues();
+  if (pValues[index] != value)
+  {
+    pValues[index] = value;
+    table3D_markDirty(pTable, index);
+  }
+}
+
+void table3D_setXAxisValue(table3D *pTable, byte index, int16_t value)
+{
+  int16_t *pXAxis = pTable->getXAxis();
+  if (pXAxis[index] != value)
+  {
+    pXAxis[index] = value;
+    table3D_markDirty(pTable, sq(pTable->axisSize) + index);
+  }
+}
+
+void table3D_setYAxisValue(table3D *pTable, byte index, int16_t value)
+{
+  int16_t *pYAxis = pTable->getYAxis();
+  if (pYAxis[index] != value)
+  {
+    pYAxis[index] = value;
+    table3D_markDirty(pTable, sq(pTable->axisSize) + pTable->axisSize + index);
+  }
+}
+
+bool table3D_isDirty(const table3D *pTable)
+{
+  const uint8_t *pDirty = pTable->getDirtyBits();
+  for (int16_t loop = pTable->dirtySizeInBytes()-1; loop >= 0; loop--)
+  {
+    if (pDirty[loop] != 0) { return true; }
+  }
+  return false;
+}
+
+uint16_t table3D_burn(table3D *pTable, uint16_t eepromAddress)
+{
+  uint16_t bytesWritten = 0;
+  const uint16_t valueCount = sq(pTable->axisSize);
+  const uint8_t *pData = (const uint8_t*)pTable->getValues();
+  uint8_t *pDirty = pTable->getDirtyBits();
+
+  for (int16_t dirtyByte = 0; dirtyByte < pTable->dirtySizeInBytes(); dirtyByte++)
+  {
+    //Most of the bitmap will be clean after a few tuner edits, so skip 8 entries at a time
+    if (pDirty[dirtyByte] == 0) { continue; }
+
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      if ((pDirty[dirtyByte] & (1U << bit)) == 0) { continue; }
+
+      uint16_t index = (dirtyByte * 8) + bit;
+      if (index < valueCount)
       {
-        q = (long)Y - yMinValue;
-        q = (q << TABLE_SHIFT_FACTOR);
+        //1 byte per value
+        EEPROM.update(eepromAddress + index, pData[index]);
+        bytesWritten += 1;
       }
-      //Standard case
       else
       {
-        q = long(Y) - yMaxValue;
-        q = TABLE_SHIFT_POWER - ( (q << TABLE_SHIFT_FACTOR) / (yMinValue - yMaxValue) );
+        //2 bytes per axis entry. X & Y axes are contiguous, directly after the values
+        uint16_t offset = valueCount + ((index - valueCount) * sizeof(int16_t));
+        EEPROM.update(eepromAddress + offset, pData[offset]);
+        EEPROM.update(eepromAddress + offset + 1, pData[offset + 1]);
+        bytesWritten += 2;
       }
-
-      uint32_t m = ((TABLE_SHIFT_POWER-p) * (TABLE_SHIFT_POWER-q)) >> TABLE_SHIFT_FACTOR;
-      uint32_t n = (p * (TABLE_SHIFT_POWER-q)) >> TABLE_SHIFT_FACTOR;
-      uint32_t o = ((TABLE_SHIFT_POWER-p) * q) >> TABLE_SHIFT_FACTOR;
-      uint32_t r = (p * q) >> TABLE_SHIFT_FACTOR;
-      tableResult = ( (A * m) + (B * n) + (C * o) + (D * r) ) >> TABLE_SHIFT_FACTOR;
     }
+    pDirty[dirtyByte] = 0;
+  }
 
-    //Update the tables cache data
-    fromTable->lastXInput = X_in;
-    fromTable->lastYInput = Y_in;
-    fromTable->lastOutput = tableResult;
-    fromTable->cacheIsValid = true;
-
-    return tableResult;
+  return bytesWritten;
 }
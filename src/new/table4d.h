@@ -0,0 +1,83 @@
+/*
+Compact 4D tables: a stack of 3D tables along a third (Z) axis. E.g. RPM x load x ethanol content.
+These share the axis search, caching & interpolation code with the 3D tables
+*/
+#ifndef TABLE4D_H
+#define TABLE4D_H
+#include <Arduino.h>
+#include "table_common.h"
+
+struct table4D {
+protected:
+  // Prevent direct creation - must use derived class
+  table4D(int8_t size, int8_t zSize) : axisSize(size), zAxisSize(zSize), cacheIsValid(false) {}
+
+public:
+  int8_t axisSize;  ///< Size of the X & Y axes
+  int8_t zAxisSize; ///< Size of the Z axis (number of X/Y layers)
+
+  //Store the last X, Y and Z coordinates in the table. This is used to make the next check faster
+  byte lastXMax, lastXMin;
+  byte lastYMax, lastYMin;
+  byte lastZMax, lastZMin;
+
+  //Store the last input and output values, again for caching purposes
+  int16_t lastXInput, lastYInput, lastZInput;
+  byte lastOutput; //This will need changing if we ever have 16-bit table values
+  bool cacheIsValid; ///< This tracks whether the tables cache should be used. Ordinarily this is true, but is set to false whenever TunerStudio sends a new value for the table
+
+  // These will be completely inlined.
+  inline int16_t layerSizeInBytes() const { return sq(axisSize)*sizeof(int8_t); }
+  inline int16_t valuesSizeInBytes() const { return layerSizeInBytes()*zAxisSize; }
+  inline int16_t axisSizeInBytes() const { return axisSize*sizeof(int16_t); }
+  // Size of the values + all axes. This is also the table footprint in EEPROM
+  inline int16_t dataSizeInBytes() const { return valuesSizeInBytes()+(2*axisSizeInBytes())+(zAxisSize*sizeof(int16_t)); }
+
+  // These rely on the derived class memory layout - see table3D
+  inline int16_t* getXAxis() const { return (int16_t*)((int8_t*)this+sizeof(table4D)+valuesSizeInBytes()); }
+  inline int16_t* getYAxis() const { return (int16_t*)((int8_t*)this+sizeof(table4D)+valuesSizeInBytes()+axisSizeInBytes()); }
+  inline int16_t* getZAxis() const { return (int16_t*)((int8_t*)this+sizeof(table4D)+valuesSizeInBytes()+(2*axisSizeInBytes())); }
+  inline int8_t* getValues() const { return (int8_t*)this+sizeof(table4D); }
+  // The X/Y values for a single Z axis bin. Same layout as a table3D
+  inline int8_t* getLayer(byte z) const { return getValues()+(z*layerSizeInBytes()); }
+
+  // Derived table4D_impl will place data here
+  // int8_t values[zSize][size][size]
+  // int16_t _axisX[size];
+  // int16_t _axisY[size];
+  // int16_t _axisZ[zSize];
+};
+
+template <int8_t _Size, int8_t _ZSize>
+struct table4D_impl: public table4D
+{
+public:
+  table4D_impl() : table4D(_Size, _ZSize)
+  {
+  }
+
+  // The EEPROM footprint (dataSizeInBytes()) at compile time
+  static constexpr uint16_t eepromSize = (_ZSize*_Size*_Size*sizeof(int8_t)) + (2*_Size*sizeof(int16_t)) + (_ZSize*sizeof(int16_t));
+
+private:
+  int8_t _values[_ZSize*_Size*_Size];
+  int16_t _axisX[_Size];
+  int16_t _axisY[_Size];
+  int16_t _axisZ[_ZSize];
+};
+
+/*
+Each Z axis bin is laid out like a 3D table (see table3d.h). The X & Z axes are
+ascending, the Y axis is descending.
+
+The X & Y bins & weights are found once and shared by both Z layers, so this
+is considerably cheaper than two get3DTableValue() calls plus a blend.
+*/
+int get4DTableValue(struct table4D *fromTable, int, int, int);
+
+// Write the table to EEPROM, starting at eepromAddress. The EEPROM layout mirrors
+// the in-memory data (values, X axis, Y axis, Z axis). As for table2D_burn(), this
+// updates every byte. Returns the number of bytes written
+uint16_t table4D_burn(const struct table4D *pTable, uint16_t eepromAddress);
+
+#endif // TABLE4D_H
@@ -0,0 +1,103 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "table4d.h"
+#include "table_common.hpp"
+
+//Bilinear interpolation of a single Z layer, *without* the final shift. I.e. the result is scaled by TABLE_SHIFT_POWER
+static inline long interpolateLayer(const int8_t *pLayer, int8_t axisSize, byte xMin, byte xMax, byte yMin, byte yMax, long m, long n, long o, long r)
+{
+  //See get3DTableValue for the corner naming
+  long A = pLayer[yMin * axisSize + xMin];
+  long B = pLayer[yMin * axisSize + xMax];
+  long C = pLayer[yMax * axisSize + xMin];
+  long D = pLayer[yMax * axisSize + xMax];
+
+  //Check that all values aren't just the same (This regularly happens with things like the fuel trim maps)
+  if( (A == B) && (A == C) && (A == D) ) { return A << TABLE_SHIFT_FACTOR; }
+  return (A * m) + (B * n) + (C * o) + (D * r);
+}
+
+//This function pulls a value from a 4D table given a target for X, Y and Z coordinates.
+//It performs a trilinear interpolation: bilinear within the 2 Z layers either side of Z, followed by a linear blend between them
+int get4DTableValue(table4D *fromTable, int Z_in, int Y_in, int X_in)
+{
+  int X = X_in;
+  int Y = Y_in;
+  int Z = Z_in;
+
+  //0th check is whether the same X, Y and Z values are being sent as last time
+  if( (X_in == fromTable->lastXInput) && (Y_in == fromTable->lastYInput) && (Z_in == fromTable->lastZInput) && (fromTable->cacheIsValid == true))
+  {
+    return fromTable->lastOutput;
+  }
+
+  //If the requested values are greater/small than the maximum/minimum bins, reset them to be that value
+  const int16_t *pXAxis = fromTable->getXAxis();
+  if(X > pXAxis[fromTable->axisSize-1]) { X = pXAxis[fromTable->axisSize-1]; }
+  if(X < pXAxis[0]) { X = pXAxis[0]; }
+
+  const int16_t *pYAxis = fromTable->getYAxis();
+  if(Y > pYAxis[0]) { Y = pYAxis[0]; }
+  if(Y < pYAxis[fromTable->axisSize-1]) { Y = pYAxis[fromTable->axisSize-1]; }
+
+  const int16_t *pZAxis = fromTable->getZAxis();
+  if(Z > pZAxis[fromTable->zAxisSize-1]) { Z = pZAxis[fromTable->zAxisSize-1]; }
+  if(Z < pZAxis[0]) { Z = pZAxis[0]; }
+
+  //Commence the lookups on the X, Y and Z axis
+  findAscendingAxisBin(pXAxis, fromTable->axisSize, X, fromTable->lastXMin, fromTable->lastXMax);
+  byte xMin = fromTable->lastXMin;
+  byte xMax = fromTable->lastXMax;
+  findDescendingAxisBin(pYAxis, fromTable->axisSize, Y, fromTable->lastYMin, fromTable->lastYMax);
+  byte yMin = fromTable->lastYMin;
+  byte yMax = fromTable->lastYMax;
+  findAscendingAxisBin(pZAxis, fromTable->zAxisSize, Z, fromTable->lastZMin, fromTable->lastZMax);
+  byte zMin = fromTable->lastZMin;
+  byte zMax = fromTable->lastZMax;
+
+  //The X/Y weights are the same for both layers
+  unsigned long p = ascendingAxisWeight(X, pXAxis[xMin], pXAxis[xMax]);
+  unsigned long q = descendingAxisWeight(Y, pYAxis[yMin], pYAxis[yMax]);
+  long m = ((TABLE_SHIFT_POWER-p) * (TABLE_SHIFT_POWER-q)) >> TABLE_SHIFT_FACTOR;
+  long n = (p * (TABLE_SHIFT_POWER-q)) >> TABLE_SHIFT_FACTOR;
+  long o = ((TABLE_SHIFT_POWER-p) * q) >> TABLE_SHIFT_FACTOR;
+  long r = (p * q) >> TABLE_SHIFT_FACTOR;
+
+  //Only interpolate both layers if Z falls between 2 bins. Typically Z sits on a bin (E.g. E0 or E85), in which case only that layer is needed.
+  //Depending on which bin search path was taken, that bin is either zMin (s == 0) or zMax (s == TABLE_SHIFT_POWER)
+  long s = ascendingAxisWeight(Z, pZAxis[zMin], pZAxis[zMax]);
+  long result;
+  if (s == (long)TABLE_SHIFT_POWER)
+  {
+    result = interpolateLayer(fromTable->getLayer(zMax), fromTable->axisSize, xMin, xMax, yMin, yMax, m, n, o, r);
+  }
+  else
+  {
+    result = interpolateLayer(fromTable->getLayer(zMin), fromTable->axisSize, xMin, xMax, yMin, yMax, m, n, o, r);
+    if (s != 0)
+    {
+      long result2 = interpolateLayer(fromTable->getLayer(zMax), fromTable->axisSize, xMin, xMax, yMin, yMax, m, n, o, r);
+      result = result + (((result2 - result) * s) >> TABLE_SHIFT_FACTOR);
+    }
+  }
+  int tableResult = result >> TABLE_SHIFT_FACTOR;
+
+  //Update the tables cache data
+  fromTable->lastXInput = X_in;
+  fromTable->lastYInput = Y_in;
+  fromTable->lastZInput = Z_in;
+  fromTable->lastOutput = tableResult;
+  fromTable->cacheIsValid = true;
+
+  return tableResult;
+}
+
+uint16_t table4D_burn(const table4D *pTable, uint16_t eepromAddress)
+{
+  const uint8_t *pData = (const uint8_t*)pTable->getValues();
+  for (int16_t loop = 0; loop < pTable->dataSizeInBytes(); loop++)
+  {
+    EEPROM.update(eepromAddress + loop, pData[loop]);
+  }
+  return pTable->dataSizeInBytes();
+}
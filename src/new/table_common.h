@@ -0,0 +1,15 @@
+/*
+Definitions shared by all of the compact table types (2D, 3D etc)
+*/
+#ifndef TABLE_COMMON_H
+#define TABLE_COMMON_H
+#include <Arduino.h>
+
+#define TABLE_RPM_MULTIPLIER  100
+#define TABLE_LOAD_MULTIPLIER 2
+
+//The shift amount used for the table interpolation calculations
+#define TABLE_SHIFT_FACTOR  8
+#define TABLE_SHIFT_POWER   (1UL<<TABLE_SHIFT_FACTOR)
+
+#endif // TABLE_COMMON_H
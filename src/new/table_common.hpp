@@ -0,0 +1,126 @@
+/*
+The axis bin search & interpolation weight calculations shared by all of the compact table types.
+These are all inlined into the individual table lookup functions.
+*/
+#ifndef TABLE_COMMON_HPP
+#define TABLE_COMMON_HPP
+#include <Arduino.h>
+#include "table_common.h"
+
+//Find the bin on an ascending axis (E.g. RPM) that contains value. The value must already be clamped to the axis range.
+//On entry binMin & binMax are the bin found by the previous lookup - on exit they are the bin containing value.
+//Note: Rather than looping from pAxis[0] up to pAxis[max], we start at pAxis[Max] and go down.
+//      This is because the important tables (fuel and injection) will have the highest RPM at the top of the X axis, so starting there will mean the best case occurs when the RPM is highest (And hence the CPU is needed most)
+static inline void findAscendingAxisBin(const int16_t *pAxis, int8_t axisSize, int value, byte &binMin, byte &binMax)
+{
+  //1st check is whether we're still in the same bin as last time
+  if ( (value <= pAxis[binMax]) && (value > pAxis[binMin]) )
+  {
+    return;
+  }
+  //2nd check is whether we're in the next bin (To the right)
+  if ( ((binMax + 1) < axisSize ) && (value <= pAxis[binMax + 1]) && (value > pAxis[binMin + 1]) ) //First make sure we're not already at the last bin
+  {
+    binMax = binMax + 1;
+    binMin = binMin + 1;
+    return;
+  }
+  //3rd check is to look at the previous bin (to the left)
+  if ( (binMin > 0 ) && (value <= pAxis[binMax - 1]) && (value > pAxis[binMin - 1]) ) //First make sure we're not already at the first bin
+  {
+    binMax = binMax - 1;
+    binMin = binMin - 1;
+    return;
+  }
+
+  //If it's not caught by one of the above scenarios, give up and just run the loop
+  for (int8_t x = axisSize-1; x >= 0; x--)
+  {
+    //Checks the case where the value is exactly what was requested
+    if ( (value == pAxis[x]) || (x == 0) )
+    {
+      binMax = x;
+      binMin = x;
+      return;
+    }
+    //Normal case
+    if ( (value <= pAxis[x]) && (value > pAxis[x-1]) )
+    {
+      binMax = x;
+      binMin = x-1;
+      return;
+    }
+  }
+}
+
+//Find the bin on a descending axis (E.g. the load axis, which is stored highest first) that contains value.
+//The value must already be clamped to the axis range.
+//On entry binMin & binMax are the bin found by the previous lookup - on exit they are the bin containing value.
+static inline void findDescendingAxisBin(const int16_t *pAxis, int8_t axisSize, int value, byte &binMin, byte &binMax)
+{
+  //1st check is whether we're still in the same bin as last time
+  if ( (value >= pAxis[binMax]) && (value < pAxis[binMin]) )
+  {
+    return;
+  }
+  //2nd check is whether we're in the next MAP/TPS bin (Next one up)
+  if ( (binMin > 0 ) && (value <= pAxis[binMin - 1 ]) && (value > pAxis[binMax - 1]) ) //First make sure we're not already at the top bin
+  {
+    binMax = binMax - 1;
+    binMin = binMin - 1;
+    return;
+  }
+  //3rd check is to look at the previous bin (Next one down)
+  if ( ((binMax + 1) < axisSize) && (value <= pAxis[binMin + 1]) && (value > pAxis[binMax + 1]) ) //First make sure we're not already at the bottom bin
+  {
+    binMax = binMax + 1;
+    binMin = binMin + 1;
+    return;
+  }
+
+  //If it's not caught by one of the above scenarios, give up and just run the loop
+  for (int8_t y = axisSize-1; y >= 0; y--)
+  {
+    //Checks the case where the value is exactly what was requested
+    if ( (value == pAxis[y]) || (y==0) )
+    {
+      binMax = y;
+      binMin = y;
+      return;
+    }
+    //Normal case
+    if ( (value >= pAxis[y]) && (value < pAxis[y-1]) )
+    {
+      binMax = y;
+      binMin = y-1;
+      return;
+    }
+  }
+}
+
+//Create some normalised position values
+//These are essentially percentages (between 0 and 1, scaled by TABLE_SHIFT_POWER) of where the desired value falls between the nearest bins on each axis
+
+//Position within a bin on an ascending axis: 0 at minValue, TABLE_SHIFT_POWER at maxValue
+static inline unsigned long ascendingAxisWeight(int value, int minValue, int maxValue)
+{
+  unsigned long p = (long)value - minValue;
+  if (maxValue == minValue) { return (p << TABLE_SHIFT_FACTOR); }  //This only occurs if the requested value was equal to one of the axis bins
+  return ( (p << TABLE_SHIFT_FACTOR) / (maxValue - minValue) ); //This is the standard case
+}
+
+//Position within a bin on a descending axis: 0 at minValue (the higher value), TABLE_SHIFT_POWER at maxValue
+static inline unsigned long descendingAxisWeight(int value, int minValue, int maxValue)
+{
+  unsigned long q;
+  if (maxValue == minValue)
+  {
+    q = (long)value - minValue;
+    return (q << TABLE_SHIFT_FACTOR);
+  }
+  //Standard case
+  q = long(value) - maxValue;
+  return TABLE_SHIFT_POWER - ( (q << TABLE_SHIFT_FACTOR) / (minValue - maxValue) );
+}
+
+#endif // TABLE_COMMON_HPP
@@ -0,0 +1,91 @@
+/*
+Compile time table registry.
+
+Every table is declared, with its name, EEPROM address & type, in a single list macro:
+
+  #define TABLE_REGISTRY(ENTRY) \
+    ENTRY(fuelTable, 0, table3D_impl<16>) \
+    ENTRY(wueCurve, 320, table2D_impl<10>) \
+    ENTRY(fuelTable4D, 350, table4D_impl<16, 4>)
+
+  DEFINE_TABLE_REGISTRY(TABLE_REGISTRY)
+
+DEFINE_TABLE_REGISTRY() then:
+  1. Declares each table as a global, plus a <name>EepromAddress constant
+  2. Computes the tables total SRAM usage & checks it against TABLE_SRAM_BUDGET at compile time
+  3. Checks at compile time that the tables are in EEPROM address order, don't overlap & fit in
+     TABLE_EEPROM_SIZE
+  4. Defines tableRegistry_forEach(visitor), which calls visitor(table) for each table in list
+     order. This expands to one direct call per table, so there is no pointer table or loop overhead.
+     The visitor can be a temporary (E.g. tableRegistry_forEach(tableInvalidateVisitor())) or, if
+     it accumulates results, a named object.
+  5. Defines tableRegistry_burn(), which burns each table to its EEPROM address
+
+A visitor is any type with operator() overloads for the table types in the registry. E.g. batch
+initialisation: overload operator() for table2D&, table3D& & table4D& & size each table from its
+own header (axisSize etc).
+
+The EEPROM addresses are fixed, rather than derived from the list order & table sizes, so adding,
+removing or resizing a table never moves the stored tune of another table. Adding a table is then
+a one line change: pick an unused address range & the compiler checks the rest.
+*/
+#ifndef TABLE_REGISTRY_H
+#define TABLE_REGISTRY_H
+#include <Arduino.h>
+#include "table2d.h"
+#include "table3d.h"
+#include "table4d.h"
+
+//The maximum SRAM (in bytes) that the registered tables may use. Override before including this file
+#ifndef TABLE_SRAM_BUDGET
+#define TABLE_SRAM_BUDGET 4096
+#endif
+
+//The EEPROM (in bytes) available to the registered tables. Override before including this file
+#ifndef TABLE_EEPROM_SIZE
+#define TABLE_EEPROM_SIZE 4096
+#endif
+
+//The type is last & variadic, so template types containing commas (E.g. table4D_impl<16, 4>) work unchanged
+#define TABLE_REGISTRY_DECLARE_(name, eepromAddress, ...) __VA_ARGS__ name; constexpr uint16_t name##EepromAddress = eepromAddress;
+#define TABLE_REGISTRY_COUNT_(name, eepromAddress, ...) + 1
+//Summed as 32 bits, since size_t is only 16 bits on AVR & the total must not wrap before it is checked
+#define TABLE_REGISTRY_SIZEOF_(name, eepromAddress, ...) + (uint32_t)sizeof(__VA_ARGS__)
+#define TABLE_REGISTRY_EEPROM_START_(name, eepromAddress, ...) (uint32_t)(eepromAddress),
+#define TABLE_REGISTRY_EEPROM_END_(name, eepromAddress, ...) (uint32_t)(eepromAddress) + __VA_ARGS__::eepromSize,
+#define TABLE_REGISTRY_VISIT_(name, eepromAddress, ...) visitor(name);
+#define TABLE_REGISTRY_BURN_(name, eepromAddress, ...) bytesWritten += tableRegistry_burnTable(name, eepromAddress);
+
+#define DEFINE_TABLE_REGISTRY(LIST) \
+  LIST(TABLE_REGISTRY_DECLARE_) \
+  constexpr uint8_t tableRegistryCount = 0 LIST(TABLE_REGISTRY_COUNT_); \
+  constexpr uint32_t tableRegistrySramSize = 0 LIST(TABLE_REGISTRY_SIZEOF_); \
+  static_assert(tableRegistrySramSize <= TABLE_SRAM_BUDGET, "The registered tables exceed TABLE_SRAM_BUDGET"); \
+  constexpr uint32_t tableRegistryEepromStart[] = { LIST(TABLE_REGISTRY_EEPROM_START_) }; \
+  constexpr uint32_t tableRegistryEepromEnd[] = { LIST(TABLE_REGISTRY_EEPROM_END_) }; \
+  static_assert(tableRegistry_eepromLayoutIsValid(tableRegistryEepromStart, tableRegistryEepromEnd, tableRegistryCount), \
+                "The registered tables are not in EEPROM address order, overlap or exceed TABLE_EEPROM_SIZE"); \
+  template <typename _Visitor> \
+  inline void tableRegistry_forEach(_Visitor &&visitor) { LIST(TABLE_REGISTRY_VISIT_) } \
+  inline uint16_t tableRegistry_burn() { uint16_t bytesWritten = 0; LIST(TABLE_REGISTRY_BURN_) return bytesWritten; }
+
+//Each table must end at or before the start of the next one & the last one must fit in TABLE_EEPROM_SIZE
+constexpr bool tableRegistry_eepromLayoutIsValid(const uint32_t *pStart, const uint32_t *pEnd, uint8_t count)
+{
+  return (count == 1) ? (pEnd[0] <= TABLE_EEPROM_SIZE)
+                      : ( (pEnd[0] <= pStart[1]) && tableRegistry_eepromLayoutIsValid(pStart+1, pEnd+1, count-1) );
+}
+
+//Used by tableRegistry_burn(). Returns the number of bytes written
+inline uint16_t tableRegistry_burnTable(table2D &table, uint16_t eepromAddress) { return table2D_burn(&table, eepromAddress); }
+inline uint16_t tableRegistry_burnTable(table3D &table, uint16_t eepromAddress) { return table3D_burn(&table, eepromAddress); }
+inline uint16_t tableRegistry_burnTable(table4D &table, uint16_t eepromAddress) { return table4D_burn(&table, eepromAddress); }
+
+// Visitor: invalidate every tables lookup cache. E.g. after loading a new tune
+struct tableInvalidateVisitor {
+  inline void operator()(table2D &table) { table.cacheIsValid = false; }
+  inline void operator()(table3D &table) { table3D_invalidate(&table); }
+  inline void operator()(table4D &table) { table.cacheIsValid = false; }
+};
+
+#endif // TABLE_REGISTRY_H
@@ -0,0 +1,70 @@
+/*
+Rate scheduled, lazily evaluated 3D tables.
+
+Many tables (trims, WMI, VVT targets etc) don't need to be looked up on every
+tooth. Each table is registered with the inputs it is looked up with, how far
+those inputs can move and how old the result can get before it must be
+refreshed. Callers read the cached value via tableSchedule_getValue(), which
+only performs a lookup if the value is stale. Calling tableScheduleGroup_service()
+once per main loop refreshes stale tables ahead of time, one per call, which
+spreads the table CPU load across the loop.
+*/
+#ifndef TABLE_SCHEDULER_H
+#define TABLE_SCHEDULER_H
+#include <Arduino.h>
+#include "table3d.h"
+
+//Units for the staleness budget
+#define TABLE_BUDGET_MS       0
+#define TABLE_BUDGET_CYCLES   1 ///< Engine cycles, as counted by tableSchedule_engineCycle()
+
+struct table3DSchedule {
+  table3D *pTable;
+  const int16_t *pXInput; ///< Where to read the X input from. E.g. &currentStatus.RPM
+  const int16_t *pYInput; ///< Where to read the Y input from
+  uint16_t xThreshold;    ///< Refresh once X has moved more than this from the last refresh
+  uint16_t yThreshold;    ///< Refresh once Y has moved more than this from the last refresh
+  uint16_t budget;        ///< Refresh once the value is this old (in budgetUnit). Maximum of 65535
+  uint8_t budgetUnit;     ///< TABLE_BUDGET_MS or TABLE_BUDGET_CYCLES
+
+  //The inputs, time stamp, table changeCount & result of the last refresh
+  int16_t lastXInput, lastYInput;
+  uint32_t lastRefresh;
+  uint16_t changeCount;
+  int value;
+  bool isValid;
+};
+
+// A set of scheduled tables that are serviced together
+struct table3DScheduleGroup {
+  table3DSchedule *pSchedules;
+  uint8_t count;
+  uint8_t next; ///< Round robin position, so every table gets a turn to be refreshed
+};
+
+void tableSchedule_init(struct table3DSchedule *pSchedule, struct table3D *pTable,
+                        const int16_t *pYInput, const int16_t *pXInput,
+                        uint16_t yThreshold, uint16_t xThreshold,
+                        uint16_t budget, uint8_t budgetUnit);
+
+// Call once per engine cycle. Drives the TABLE_BUDGET_CYCLES budgets.
+// This is safe to call from an ISR (E.g. the crank trigger). The other functions
+// must only be called from the main loop
+void tableSchedule_engineCycle();
+
+// Force a refresh on the next access. Changes to the table itself (see table3D_invalidate())
+// are picked up without this
+void tableSchedule_invalidate(struct table3DSchedule *pSchedule);
+
+bool tableSchedule_isStale(const struct table3DSchedule *pSchedule);
+
+// The table value for the current inputs: the cached value, unless it is stale
+int tableSchedule_getValue(struct table3DSchedule *pSchedule);
+
+void tableScheduleGroup_init(struct table3DScheduleGroup *pGroup, struct table3DSchedule *pSchedules, uint8_t count);
+
+// Refresh at most one stale table in the group. Call once per main loop.
+// Returns true if a table was refreshed
+bool tableScheduleGroup_service(struct table3DScheduleGroup *pGroup);
+
+#endif // TABLE_SCHEDULER_H
@@ -0,0 +1,101 @@
+#include <Arduino.h>
+#include <util/atomic.h>
+#include "table_scheduler.h"
+
+static volatile uint32_t _tableScheduleEngineCycles = 0;
+
+static inline uint32_t tableSchedule_now(uint8_t budgetUnit)
+{
+  if (budgetUnit == TABLE_BUDGET_CYCLES)
+  {
+    //The counter may be updated from an ISR & a 32-bit read isn't atomic on AVR.
+    //Restore (rather than enable) interrupts, so this is safe to call with them disabled
+    uint32_t cycles;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { cycles = _tableScheduleEngineCycles; }
+    return cycles;
+  }
+  return millis();
+}
+
+static inline bool tableSchedule_hasMoved(int16_t input, int16_t lastInput, uint16_t threshold)
+{
+  long delta = (long)input - lastInput;
+  if (delta < 0) { delta = -delta; }
+  return delta > threshold;
+}
+
+static inline void tableSchedule_refresh(table3DSchedule *pSchedule)
+{
+  pSchedule->lastXInput = *pSchedule->pXInput;
+  pSchedule->lastYInput = *pSchedule->pYInput;
+  pSchedule->value = get3DTableValue(pSchedule->pTable, pSchedule->lastYInput, pSchedule->lastXInput);
+  pSchedule->lastRefresh = tableSchedule_now(pSchedule->budgetUnit);
+  pSchedule->changeCount = pSchedule->pTable->changeCount;
+  pSchedule->isValid = true;
+}
+
+void tableSchedule_init(table3DSchedule *pSchedule, table3D *pTable,
+                        const int16_t *pYInput, const int16_t *pXInput,
+                        uint16_t yThreshold, uint16_t xThreshold,
+                        uint16_t budget, uint8_t budgetUnit)
+{
+  pSchedule->pTable = pTable;
+  pSchedule->pXInput = pXInput;
+  pSchedule->pYInput = pYInput;
+  pSchedule->xThreshold = xThreshold;
+  pSchedule->yThreshold = yThreshold;
+  pSchedule->budget = budget;
+  pSchedule->budgetUnit = budgetUnit;
+  pSchedule->isValid = false;
+}
+
+void tableSchedule_engineCycle()
+{
+  _tableScheduleEngineCycles++;
+}
+
+void tableSchedule_invalidate(table3DSchedule *pSchedule)
+{
+  pSchedule->isValid = false;
+}
+
+bool tableSchedule_isStale(const table3DSchedule *pSchedule)
+{
+  //The table has changed since the last refresh (E.g. a tuner edit)
+  if ( (pSchedule->isValid == false) || (pSchedule->changeCount != pSchedule->pTable->changeCount) ) { return true; }
+
+  //Same width as millis(), so the age is wrap around safe
+  if ( (tableSchedule_now(pSchedule->budgetUnit) - pSchedule->lastRefresh) >= pSchedule->budget ) { return true; }
+
+  return tableSchedule_hasMoved(*pSchedule->pXInput, pSchedule->lastXInput, pSchedule->xThreshold)
+      || tableSchedule_hasMoved(*pSchedule->pYInput, pSchedule->lastYInput, pSchedule->yThreshold);
+}
+
+int tableSchedule_getValue(table3DSchedule *pSchedule)
+{
+  if (tableSchedule_isStale(pSchedule)) { tableSchedule_refresh(pSchedule); }
+  return pSchedule->value;
+}
+
+void tableScheduleGroup_init(table3DScheduleGroup *pGroup, table3DSchedule *pSchedules, uint8_t count)
+{
+  pGroup->pSchedules = pSchedules;
+  pGroup->count = count;
+  pGroup->next = 0;
+}
+
+bool tableScheduleGroup_service(table3DScheduleGroup *pGroup)
+{
+  //Start where the last call left off, so a table that is always stale can't starve the others
+  for (uint8_t loop = 0; loop < pGroup->count; loop++)
+  {
+    table3DSchedule *pSchedule = &pGroup->pSchedules[pGroup->next];
+    pGroup->next = (pGroup->next + 1) % pGroup->count;
+    if (tableSchedule_isStale(pSchedule))
+    {
+      tableSchedule_refresh(pSchedule);
+      return true;
+    }
+  }
+  return false;
+}